@@ -1,8 +1,15 @@
 #include <iostream>
 #include <ctime>
 #include <cassert>
+#include <cstdlib>
+#include <chrono>
 using namespace std;
 #include "numvec.hpp"
+#include "numvec_pipeline.hpp"
+#include "numvec_compact.hpp"
+#include "numvec_tune.hpp"
+#include "numvec_packed.hpp"
+#include "numvec_xc.hpp"
 
 
 // The is the formula of the popular Lee-Yang-Parr correlation functional.
@@ -20,11 +27,12 @@ void lypc(T &out,
   const double Dd = 0.349;
   const double CF = 0.3*pow(3*M_PI*M_PI,2.0/3.0);
   T n = a+b;
-  T icbrtn = pow(n,-1.0/3.0);
+  T cbrtn, icbrtn;
+  cbrt_and_rcbrt(n, cbrtn, icbrtn);
+  T n2 = n*n;
   T P = 1/(1+Dd*icbrtn);
-  T omega = exp(-C*icbrtn)*P*pow(n,-11.0/3.0);
+  T omega = exp(-C*icbrtn)*P/(cbrtn*cbrtn*n2*n);
   T delta = icbrtn*(C+Dd*P);
-  T n2 = n*n;
   out =
     -A*(4*a*b*P/n +
 	B*omega*(a*b*(pow(2,11.0/3.0)*CF*(pow(a,8.0/3.0)+pow(b,8.0/3.0))
@@ -50,7 +58,8 @@ void lypc_disciplined(T &out,
   const double Dd = 0.349;
   const double CF = 0.3*pow(3*M_PI*M_PI,2.0/3.0);
   T n = a+b;
-  T icbrtn = pow(n,-1.0/3.0);
+  T cbrtn, icbrtn;
+  cbrt_and_rcbrt(n, cbrtn, icbrtn);
   T tmp = Dd*icbrtn;
   tmp += 1;
   T P = 1/tmp;
@@ -60,8 +69,12 @@ void lypc_disciplined(T &out,
   icbrtn *= -C;
   T omega = exp(icbrtn);
   omega *= P;
-  omega *= pow(n,-11.0/3.0);
   T n2 = n*n;
+  // n^(-11/3) = 1/(n^3 n^(2/3))
+  tmp = cbrtn*cbrtn;
+  tmp *= n2;
+  tmp *= n;
+  omega /= tmp;
   out = 4*a;
   out *= b;
   out *= P/n;
@@ -145,17 +158,195 @@ void bench_numvec(double *dst, const double *src, size_t len)
     }
 }
 
+// Inputs stored in reduced precision, computed in double.
+template<typename S, int blocksize>
+void bench_numvec_packed(double *dst, const numvec_packed<S,blocksize> *ps, size_t len)
+{
+  assert(len % blocksize == 0);
+  numvec<double,blocksize> *pd = reinterpret_cast< numvec<double,blocksize>* > (dst);
+  numvec<double,blocksize> in[5];
+  for (size_t i = 0; i < (len/blocksize)/5; i++)
+    {
+      for (int k=0;k<5;k++)
+	ps[i*5+k].load(in[k]);
+      lypc_disciplined(pd[i], in[0], in[1], in[2], in[3], in[4]);
+    }
+}
+
+template<typename S, int blocksize>
+void time_packed(const char *name, double *y, const double *x, size_t len)
+{
+  numvec_packed<S,blocksize> *ps = new numvec_packed<S,blocksize>[len/blocksize];
+  for (size_t i=0;i<len/blocksize;i++)
+    ps[i].store(reinterpret_cast<const numvec<double,blocksize> *>(x)[i]);
+  for (int i=0;i<3;i++)
+    {
+      clock_t tick = clock();
+      bench_numvec_packed<S,blocksize>(y,ps,len);
+      clock_t tock = clock();
+      cout << y[len/5-1] << " Packed " << name << "<" << blocksize << "> Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+    }
+  delete[] ps;
+}
+
+// B3LYP-like local part, evaluated as one fused sweep and as one sweep
+// per functional.
+template<int blocksize>
+void time_xc(double *y, double *tmp, const double *const src[5], size_t npoints)
+{
+  const char *names[4] = {"slater", "b88", "vwn5", "lyp"};
+  const double coefs[4] = {0.08, 0.72, 0.19, 0.81};
+  numvec_xc_mix<blocksize> fused, single[4];
+  for (int k=0;k<4;k++)
+    {
+      fused.add(names[k], coefs[k]);
+      single[k].add(names[k], coefs[k]);
+    }
+  clock_t tick = clock();
+  fused.eval(y, src[0], src[1], src[2], src[3], src[4], npoints);
+  clock_t tock = clock();
+  cout << y[npoints-1] << " XC fused<" << blocksize << "> Time        : " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+  tick = clock();
+  for (size_t i=0;i<npoints;i++)
+    y[i] = 0;
+  for (int k=0;k<4;k++)
+    {
+      single[k].eval(tmp, src[0], src[1], src[2], src[3], src[4], npoints);
+      for (size_t i=0;i<npoints;i++)
+	y[i] += tmp[i];
+    }
+  tock = clock();
+  cout << y[npoints-1] << " XC per functional<" << blocksize << "> Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+}
+
+// Driver for the block length autotuner
+template<int blocksize>
+struct lypc_driver
+{
+  static void run(double *dst, const double *src, size_t len)
+  {
+    bench_numvec<blocksize>(dst, src, len);
+  }
+};
+
+// Block driver for outputs much larger than the cache: the result of
+// each block is streamed to dst with non-temporal stores, and the input
+// prefetch_distance blocks ahead is prefetched (0 disables prefetch).
+template<int blocksize>
+void bench_numvec_stream(double *dst, const double *src, size_t len, size_t prefetch_distance)
+{
+  assert(len % blocksize == 0);
+  const numvec<double,blocksize> *ps = reinterpret_cast< const numvec<double,blocksize>* > (src);
+  const size_t nblocks = (len/blocksize)/5;
+  numvec<double,blocksize> out;
+  for (size_t i = 0; i < nblocks; i++)
+    {
+      if (prefetch_distance > 0 && i + prefetch_distance < nblocks)
+	numvec_prefetch(ps + (i + prefetch_distance)*5, 5*sizeof(ps[0]));
+      lypc_disciplined(out,
+		       ps[i*5+0],
+		       ps[i*5+1],
+		       ps[i*5+2],
+		       ps[i*5+3],
+		       ps[i*5+4]);
+      numvec_stream(dst + i*blocksize, out);
+    }
+  numvec_stream_fence();
+}
+
+// Screened kernel on point-major (one array per input) data: only
+// points with a > threshold are computed, the rest are set to zero.
+template<int blocksize>
+void bench_numvec_screened(double *dst, const double *const src[5], size_t npoints,
+			   double threshold, size_t *idx)
+{
+  size_t nact = numvec_screen(src[0], npoints, threshold, idx);
+  numvec_screened_apply<double,blocksize,5>(dst, src, npoints, idx, nact, 0.0,
+					    [](numvec<double,blocksize> &out, const numvec<double,blocksize> *in)
+					    {
+					      lypc_disciplined(out, in[0], in[1], in[2], in[3], in[4]);
+					    });
+}
+
+// The same kernel with loading, computing and storing on separate
+// threads. The load stage deinterleaves the input, as a slow data
+// source would.
+template<int blocksize>
+struct lyp_input
+{
+  numvec<double,blocksize> a, b, gaa, gnn, gbb;
+};
+
+template<int blocksize>
+void bench_numvec_pipelined(numvec_pipeline<lyp_input<blocksize>, numvec<double,blocksize> > &pipe,
+			    double *dst, const double *src, size_t len)
+{
+  assert(len % blocksize == 0);
+  pipe.run((len/blocksize)/5,
+	   [=](size_t blk, lyp_input<blocksize> &in)
+	   {
+	     const double *p = src + blk*5*blocksize;
+	     for (int i=0;i<blocksize;i++)
+	       {
+		 in.a[i] = p[i];
+		 in.b[i] = p[blocksize+i];
+		 in.gaa[i] = p[2*blocksize+i];
+		 in.gnn[i] = p[3*blocksize+i];
+		 in.gbb[i] = p[4*blocksize+i];
+	       }
+	   },
+	   [](const lyp_input<blocksize> &in, numvec<double,blocksize> &out)
+	   {
+	     lypc_disciplined(out, in.a, in.b, in.gaa, in.gnn, in.gbb);
+	   },
+	   [=](size_t blk, const numvec<double,blocksize> &out)
+	   {
+	     double *p = dst + blk*blocksize;
+	     for (int i=0;i<blocksize;i++)
+	       p[i] = out[i];
+	   });
+}
 
 int main(int argc, const char *argv[])
 {
   const int len = 1<<25;
   const int blocksize = 128;
+  // Usage: benchmark [--tune] [prefetch distance]
+  // --tune measures the best block length of the kernel and saves it
+  // to numvec_tune.cfg, which is read on later runs.
+  bool tune = false;
+  size_t prefetch_distance = 2;
+  for (int i=1;i<argc;i++)
+    if (string(argv[i]) == "--tune")
+      tune = true;
+    else
+      {
+	int d = atoi(argv[i]);
+	if (d < 0)
+	  {
+	    cerr << "The prefetch distance must not be negative" << endl;
+	    return 1;
+	  }
+	prefetch_distance = d;
+      }
   double *x = new double[len];
   double *y = new double[len];  
   for (int i=0;i<len;i++)
     x[i] = i % 10 + 0.1;
   for (int i=0;i<len;i++)
     y[i] = 0;
+  numvec_tune_table tuned;
+  tuned.load("numvec_tune.cfg");
+  if (tune)
+    {
+      // A 1/8 slice of the data, in whole blocks of the largest length.
+      int best = numvec_autotune<lypc_driver>(3, y, x, (size_t)len/8);
+      cout << "Tuned block length for lypc: " << best << endl;
+      tuned.set("lypc", best);
+      if (!tuned.save("numvec_tune.cfg"))
+	cerr << "Could not write numvec_tune.cfg" << endl;
+    }
+  const int tuned_blocksize = tuned.get("lypc", blocksize);
   cout << "Main loop starting" << endl;
   for (int i=0;i<10;i++)
     {
@@ -168,7 +359,53 @@ int main(int argc, const char *argv[])
       bench_numvec<blocksize>(y,x,len);
       tock = clock();
       cout << y[len-1] << " Block<" << blocksize << "> vector Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+      tick = clock();
+      if (!numvec_dispatch<lypc_driver>(tuned_blocksize,y,x,(size_t)len))
+	cerr << "Block length " << tuned_blocksize << " is not a tuning candidate" << endl;
+      tock = clock();
+      cout << y[len-1] << " Tuned<" << tuned_blocksize << "> vector Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+      tick = clock();
+      bench_numvec_stream<blocksize>(y,x,len,prefetch_distance);
+      tock = clock();
+      cout << y[len-1] << " Block<" << blocksize << "> stream Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+    }
+  // Reduced precision input storage
+  time_packed<float,blocksize>("float", y, x, len);
+  time_packed<numvec_half,blocksize>("half", y, x, len);
+  time_packed<numvec_bfloat16,blocksize>("bfloat16", y, x, len);
+  // Screening, reading x as five point-major arrays. The inputs are
+  // i % 10 + 0.1, so a threshold of 5 skips half of the points.
+  size_t *idx = new size_t[len/5];
+  const double *src[5] = {x, x + len/5, x + 2*(len/5), x + 3*(len/5), x + 4*(len/5)};
+  for (int i=0;i<3;i++)
+    {
+      clock_t tick = clock();
+      bench_numvec_screened<blocksize>(y,src,len/5,0.0,idx);
+      clock_t tock = clock();
+      cout << y[len/5-1] << " Screened<" << blocksize << "> all points Time : " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
+      tick = clock();
+      bench_numvec_screened<blocksize>(y,src,len/5,5.0,idx);
+      tock = clock();
+      cout << y[len/5-1] << " Screened<" << blocksize << "> half points Time: " << (tock - tick)/(double)CLOCKS_PER_SEC << endl;
     }
+  delete[] idx;
+  // Functional library, on the same point-major arrays
+  double *tmp = new double[len/5];
+  for (int i=0;i<3;i++)
+    time_xc<blocksize>(y,tmp,src,len/5);
+  delete[] tmp;
+  // clock() sums over threads, so the pipeline is timed by wall clock.
+  numvec_pipeline<lyp_input<blocksize>, numvec<double,blocksize> > pipe(8);
+  chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+  bench_numvec_pipelined<blocksize>(pipe,y,x,len);
+  chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+  cout << y[len-1] << " Pipelined<" << blocksize << "> wall Time  : "
+       << chrono::duration<double>(t1 - t0).count() << endl;
+  for (int i=0;i<pipe.NSTAGES;i++)
+    if (pipe.stats(i).items > 0)
+      cout << "  " << pipe.stats(i).name << ": busy " << pipe.stats(i).busy
+	   << " s, wait " << pipe.stats(i).wait << " s, utilization " << pipe.stats(i).utilization() << endl;
+  cout << "  bottleneck: " << pipe.stats(pipe.bottleneck()).name << endl;
   delete[] x;
   delete[] y;
   return 0;
@@ -1,6 +1,14 @@
 #include <iostream>
+#include <cstdio>
+#include <limits>
 using namespace std;
 #include "numvec.hpp"
+#include "numvec_pipeline.hpp"
+#include "numvec_table.hpp"
+#include "numvec_compact.hpp"
+#include "numvec_tune.hpp"
+#include "numvec_packed.hpp"
+#include "numvec_xc.hpp"
 
 
 template<typename T>
@@ -20,6 +28,36 @@ void f1(T &res, const T &x)
   res = pow(y,3);
 }
 
+template<typename T>
+void f2(T &res, const T &x)
+{
+  T u, v, w;
+  u = sqrt(x);
+  u += cbrt(x);
+  u *= rsqrt(x);
+  res = erf(u);
+  res += erfc(x);
+  res += expm1(x);
+  res *= log1p(x);
+  v = 0.5 - x;
+  u = fabs(v);
+  res += u;
+  res += atan2(x, u);
+  res += atan2(2.0, x);
+  res *= hypot(x, 0.3);
+  u = fmin(x, 1.7);
+  res += fmax(u, v);
+  sincos(x, u, v);
+  res += u;
+  res *= v;
+  exp_and_expm1(u, v, w);
+  res += v;
+  res -= w;
+  cbrt_and_rcbrt(x, v, w);
+  res += v;
+  res *= w;
+}
+
 void test_correctness()
 {
   const int len = 4;
@@ -36,11 +74,342 @@ void test_correctness()
     }
   cout.precision(15);
   cout << "Sum of absolute differences " << sumres << endl;
+  f2(out,inp);
+  sumres = 0;
+  for (int i=0;i<len;i++)
+    {
+      double outd;
+      f2(outd,inp[i]);
+      sumres += fabs(out[i] - outd);
+    }
+  cout << "Math functions sum of absolute differences " << sumres << endl;
+  // exp_and_expm1 must keep the relative precision of exp for large
+  // negative arguments.
+  numvec<double, len> e, em1;
+  for (int i=0;i<len;i++)
+    inp[i] = -10.0*(i+1);
+  exp_and_expm1(inp, e, em1);
+  double relerr = 0;
+  for (int i=0;i<len;i++)
+    relerr = fmax(relerr, fabs(e[i] - exp(inp[i]))/exp(inp[i]));
+  cout << "exp_and_expm1 max relative error of exp " << relerr << endl;
+}
+
+// Run f1 block by block through the pipeline, with a transform stage
+// that shifts the input, and compare to the plain loop.
+void test_pipeline()
+{
+  const int len = 8;
+  const int nblocks = 37;
+  struct block { numvec<double, len> x; };
+  double inp[len*nblocks], out[len*nblocks];
+  for (int i=0;i<len*nblocks;i++)
+    inp[i] = (i % 13)*0.1 + 0.1;
+  numvec_pipeline<block, block> pipe(3);
+  pipe.run(nblocks,
+	   [&](size_t blk, block &b) { for (int i=0;i<len;i++) b.x[i] = inp[blk*len+i]; },
+	   [&](block &b) { b.x += 1.0; },
+	   [&](const block &b, block &r) { f1(r.x,b.x); },
+	   [&](size_t blk, const block &r) { for (int i=0;i<len;i++) out[blk*len+i] = r.x[i]; });
+  double sumres = 0;
+  for (int i=0;i<len*nblocks;i++)
+    {
+      double outd;
+      f1(outd,inp[i]+1.0);
+      sumres += fabs(out[i] - outd);
+    }
+  cout << "Pipeline sum of absolute differences " << sumres << endl;
+  for (int i=0;i<numvec_pipeline<block, block>::NSTAGES;i++)
+    if (pipe.stats(i).items != nblocks)
+      cout << "Pipeline stage " << pipe.stats(i).name << " processed "
+	   << pipe.stats(i).items << " blocks, expected " << nblocks << endl;
+}
+// Non-temporal stores must give the same result as a plain copy for
+// any destination alignment.
+void test_stream()
+{
+  const int len = 11;
+  numvec<double, len> v;
+  double dst[len+4];
+  for (int i=0;i<len;i++)
+    v[i] = i+0.5;
+  double sumres = 0;
+  for (int offset=0;offset<4;offset++)
+    {
+      for (int i=0;i<len+4;i++)
+	dst[i] = 0;
+      numvec_stream(dst+offset, v);
+      numvec_stream_fence();
+      for (int i=0;i<len;i++)
+	sumres += fabs(dst[offset+i] - v[i]);
+    }
+  cout << "Streaming store sum of absolute differences " << sumres << endl;
+}
+// Tabulated exp(-C*x), checked against libm inside and outside the
+// table range for each range policy.
+double expc(double x)
+{
+  return exp(-0.2533*x);
+}
+
+void test_table()
+{
+  const int len = 64;
+  const double tol = 1e-12;
+  numvec<double, len> x, y;
+  for (int i=0;i<len;i++)
+    x[i] = -1.0 + 0.19*i;
+  // A NaN argument must give NaN with the NaN policy, and a finite
+  // value (the lower end point) when clamped.
+  const int inan = 5;
+  x[inan] = std::numeric_limits<double>::quiet_NaN();
+  numvec_table<double> clamp(expc, 0.0, 10.0, tol);
+  numvec_table<double> nan(expc, 0.0, 10.0, tol, NUMVEC_TABLE_NAN);
+  numvec_table<double> exact(expc, 0.0, 10.0, tol, NUMVEC_TABLE_EXACT);
+  double maxerr = 0;
+  int nwrong = 0;
+  y = clamp(x);
+  for (int i=0;i<len;i++)
+    {
+      double xc = x[i] > 0 ? (x[i] < 10 ? x[i] : 10) : 0;
+      maxerr = fmax(maxerr, fabs(y[i] - expc(xc)));
+    }
+  y = nan(x);
+  for (int i=0;i<len;i++)
+    if (!(x[i] >= 0 && x[i] <= 10) != std::isnan(y[i]))
+      nwrong++;
+  // The exact policy must call expc itself outside [0,10]. The add and
+  // multiply forms must agree with the assignment.
+  x[inan] = 1.0;
+  numvec<double, len> y2;
+  y = exact(x);
+  y2 = 1.0;
+  y2 += exact(x);
+  y2 *= exact(x);
+  int nexact = 0;
+  for (int i=0;i<len;i++)
+    {
+      if (x[i] >= 0 && x[i] <= 10)
+	maxerr = fmax(maxerr, fabs(y[i] - expc(x[i])));
+      else if (y[i] != expc(x[i]))
+	nexact++;
+      if (y2[i] != (1 + y[i])*y[i])
+	nexact++;
+    }
+  cout << "Table with " << clamp.intervals() << " intervals, max error " << maxerr
+       << (clamp.converged() && maxerr <= tol ? "" : " ABOVE TOLERANCE")
+       << ", wrong NaN results " << nwrong << ", wrong exact results " << nexact << endl;
+}
+
+// Screened evaluation of f1(x)*y must match the full evaluation on the
+// significant points and give the fill value elsewhere.
+void test_screening()
+{
+  const int len = 8;
+  const size_t n = 101;
+  double x[n], y[n], out[n];
+  size_t idx[n], idx_if[n];
+  for (size_t i=0;i<n;i++)
+    {
+      x[i] = ((i*7) % 10)*0.1;
+      y[i] = 1 + 0.01*i;
+    }
+  size_t nact = numvec_screen(x, n, 0.45, idx);
+  size_t nact_if = numvec_screen_if(n, [&](size_t i) { return x[i] > 0.45; }, idx_if);
+  int nwrong = nact != nact_if;
+  for (size_t j=0;j<nact && j<nact_if;j++)
+    nwrong += idx[j] != idx_if[j];
+  const double *in[2] = {x, y};
+  numvec_screened_apply<double,len,2>(out, in, n, idx, nact, -1.0,
+				      [](numvec<double,len> &res, const numvec<double,len> *v)
+				      {
+					f1(res, v[0]);
+					res *= v[1];
+				      });
+  double sumres = 0;
+  for (size_t i=0;i<n;i++)
+    {
+      double outd = -1.0;
+      if (x[i] > 0.45)
+	{
+	  f1(outd, x[i]);
+	  outd *= y[i];
+	}
+      sumres += fabs(out[i] - outd);
+    }
+  cout << "Screening kept " << nact << " of " << n << " points, index mismatches " << nwrong
+       << ", sum of absolute differences " << sumres << endl;
 }
+// f1 applied block by block, for the tuner test.
+template<int len>
+struct f1_driver
+{
+  static void run(double *dst, const double *src, size_t n)
+  {
+    for (size_t i=0;i+len<=n;i+=len)
+      f1(*reinterpret_cast<numvec<double,len> *>(dst+i),
+	 *reinterpret_cast<const numvec<double,len> *>(src+i));
+  }
+};
 
+// Every tuned length must give the same result, and the tuned length
+// must survive a round trip through the configuration file.
+void test_tune()
+{
+  const size_t n = 1024;
+  double inp[n], ref[n], out[n];
+  for (size_t i=0;i<n;i++)
+    {
+      inp[i] = (i % 13)*0.1 + 0.1;
+      f1(ref[i], inp[i]);
+    }
+  int best = numvec_autotune<f1_driver>(2, out, inp, n);
+  double sumres = 0;
+  if (!numvec_dispatch<f1_driver>(best, out, inp, n))
+    sumres = -1;
+  for (size_t i=0;i<n;i++)
+    sumres += fabs(out[i] - ref[i]);
+  numvec_tune_table saved, loaded;
+  saved.set("f1", best);
+  bool roundtrip = saved.save("numvec_tune_test.cfg") && loaded.load("numvec_tune_test.cfg")
+    && loaded.get("f1", 0) == best;
+  remove("numvec_tune_test.cfg");
+  cout << "Tuned block length " << best << (roundtrip ? "" : " NOT SAVED")
+       << ", sum of absolute differences " << sumres << endl;
+}
+// Relative error of f1 computed from inputs kept in the storage type
+// S, against f1 on the double inputs.
+template<typename S>
+double packed_error()
+{
+  const int len = 64;
+  numvec<double, len> inp, out, ref;
+  numvec_packed<S, len> packed;
+  for (int i=0;i<len;i++)
+    inp[i] = 0.1 + 0.0371*i;
+  f1(ref, inp);
+  packed.store(inp);
+  packed.load(inp);
+  f1(out, inp);
+  double maxerr = 0;
+  for (int i=0;i<len;i++)
+    maxerr = fmax(maxerr, fabs(out[i] - ref[i])/fabs(ref[i]));
+  return maxerr;
+}
+
+// The vector conversions (F16C/AVX-512 when compiled in) must agree
+// with the scalar ones: exhaustively for half to float, and for a
+// sweep of floats across the half range for float to half.
+void test_packed()
+{
+  const int n = 1 << 16;
+  static numvec_half h[n], h2[n];
+  static float f[n], f2[n];
+  int nwrong = 0;
+  for (int i=0;i<n;i++)
+    h[i].bits = i;
+  numvec_widen(h, f, n);
+  numvec_narrow(f, h2, n);
+  for (int i=0;i<n;i++)
+    {
+      bool nan = std::isnan(f[i]);
+      if (numvec_float_bits(f[i]) != numvec_float_bits(numvec_half_to_float(h[i])) && !nan)
+	nwrong++;
+      if ((h2[i].bits != h[i].bits || numvec_float_to_half(f[i]).bits != h[i].bits) && !nan)
+	nwrong++;
+    }
+  for (int i=0;i<n;i++)
+    f[i] = (i % 2 ? -1 : 1)*ldexp(1.0 + (i*2654435761u % 8388608)/8388608.0, i % 44 - 28);
+  numvec_narrow(f, h, n);
+  for (int i=0;i<n;i++)
+    if (h[i].bits != numvec_float_to_half(f[i]).bits)
+      nwrong++;
+  static numvec_bfloat16 b[n];
+  numvec_narrow(f, b, n);
+  numvec_widen(b, f2, n);
+  double bferr = 0;
+  for (int i=0;i<n;i++)
+    bferr = fmax(bferr, fabs(f2[i] - f[i])/fabs(f[i]));
+  cout << "Packed conversion mismatches " << nwrong
+       << ", bfloat16 max relative rounding error " << bferr << endl;
+  cout << "Relative error of f1 with float storage " << packed_error<float>()
+       << ", half " << packed_error<numvec_half>()
+       << ", bfloat16 " << packed_error<numvec_bfloat16>() << endl;
+}
+// Energy densities of each functional at four points, from an
+// independent straightforward implementation of the formulas. The
+// columns are the points (a, b, gaa, gab, gbb) below.
+void test_xc()
+{
+  const int npoints = 4;
+  const double points[npoints][5] =
+    {
+      {0.3, 0.2, 0.05, 0.02, 0.03},
+      {1.0, 1.0, 0.5, 0.5, 0.5},
+      {0.05, 0.001, 0.01, 0.0001, 1e-6},
+      {10.0, 8.0, 30.0, 20.0, 25.0}
+    };
+  const struct { const char *name; double e[npoints]; } ref[] =
+    {
+      {"slater", {-2.9571232700140265e-01, -1.8610514726981999e+00, -1.7233483188663034e-02, -3.4935981045165228e+01}},
+      {"b88",    {-2.9776227489882068e-01, -1.8652027635427295e+00, -1.8975118363468716e-02, -3.4948366676852913e+01}},
+      {"pbex",   {-2.9739826009448223e-01, -1.8644051714605256e+00, -1.8868065936843832e-02, -3.4945909746625595e+01}},
+      {"vwn5",   {-3.2512057528999411e-02, -1.5491693141636043e-01, -1.4552210774606443e-03, -1.7389162114274592e+00}},
+      {"pw92",   {-3.2344807881554041e-02, -1.5402185538698865e-01, -1.4528147563172872e-03, -1.7294143691469714e+00}},
+      {"pbec",   {-3.1120379496558312e-02, -1.5074840050421892e-01, -5.1616896644385778e-04, -1.7209621032405218e+00}},
+      {"lyp",    {-2.1179222071825526e-02, -1.0068437915651626e-01, -1.6207104708494558e-04, -1.0440522887883090e+00}}
+    };
+  const int nref = sizeof(ref)/sizeof(ref[0]);
+  double in[5][npoints], e[npoints], mix[npoints];
+  for (int p=0;p<npoints;p++)
+    {
+      for (int k=0;k<5;k++)
+	in[k][p] = points[p][k];
+      mix[p] = 0;
+    }
+  // Each functional alone, and all of them at once with coefficients
+  // 1..nref. The block length is not a multiple of npoints, so padding
+  // is exercised.
+  numvec_xc_mix<8> all;
+  double maxerr = 0;
+  for (int f=0;f<nref;f++)
+    {
+      numvec_xc_mix<8> single;
+      if (!single.add(ref[f].name, 1.0) || !all.add(ref[f].name, f+1))
+	cout << "Unknown functional " << ref[f].name << endl;
+      single.eval(e, in[0], in[1], in[2], in[3], in[4], npoints);
+      for (int p=0;p<npoints;p++)
+	{
+	  double err = fabs(e[p] - ref[f].e[p])/fabs(ref[f].e[p]);
+	  if (err > 1e-12)
+	    cout << ref[f].name << " at point " << p << ": " << e[p]
+		 << ", reference " << ref[f].e[p] << endl;
+	  maxerr = fmax(maxerr, err);
+	  mix[p] += (f+1)*ref[f].e[p];
+	}
+    }
+  all.eval(e, in[0], in[1], in[2], in[3], in[4], npoints);
+  double mixerr = 0;
+  for (int p=0;p<npoints;p++)
+    mixerr = fmax(mixerr, fabs(e[p] - mix[p])/fabs(mix[p]));
+  // Zero density must give zero, and a fully polarized point (b = 0,
+  // through the NUMVEC_XC_TINY floor) a finite value.
+  const double pa[2] = {0.0, 0.3}, pgaa[2] = {0.0, 0.05}, zero[2] = {0.0, 0.0};
+  all.eval(e, pa, zero, pgaa, zero, zero, 2);
+  if (e[0] != 0 || !std::isfinite(e[1]))
+    cout << "Bad energy density at zero or polarized density: " << e[0] << " " << e[1] << endl;
+  cout << "Functionals max relative error " << maxerr << ", fused mix " << mixerr << endl;
+}
 
 int main(int argc, const char *argv[])
 {
   test_correctness();
+  test_pipeline();
+  test_stream();
+  test_table();
+  test_screening();
+  test_tune();
+  test_packed();
+  test_xc();
   return 0;
 }
@@ -1,6 +1,11 @@
 #ifndef NUMVEC_HPP
 #define NUMVEC_HPP
 #include <cmath>
+#include <cstddef>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 #ifdef NUMVEC_USE_VML
 #include <mkl.h>
 #endif
@@ -11,7 +16,6 @@
 // math features without creating any temporaries. For example
 // u += 12*v;
 // can be evaluated without creating a temporary vector. 
-// TODO: Complete the list of math functions
 // TODO: Full coverage testing
 // TODO: Refactor the code to use better name space separation for
 //       the auxiliary templates and types.
@@ -611,5 +615,226 @@ NUMVEC_UNARY(tanh)
 NUMVEC_UNARY(asinh)
 NUMVEC_UNARY(acosh)
 NUMVEC_UNARY(atanh)
+NUMVEC_UNARY(sqrt)
+NUMVEC_UNARY(cbrt)
+NUMVEC_UNARY(erf)
+NUMVEC_UNARY(erfc)
+NUMVEC_UNARY(expm1)
+NUMVEC_UNARY(log1p)
+NUMVEC_UNARY(fabs)
+
+// Reciprocal square root, not in the C library.
+inline float rsqrt(float x) { return 1/sqrt(x); }
+inline double rsqrt(double x) { return 1/sqrt(x); }
+inline long double rsqrt(long double x) { return 1/sqrt(x); }
+NUMVEC_UNARY(rsqrt)
+
+// BINARY MATH FUNCTIONS
+// Vector-vector, vector-scalar and scalar-vector versions. The scalar
+// is stored by value.
+
+#define NUMVEC_BINARY(FUN)\
+struct numvec_op_##FUN##_vv;\
+struct numvec_op_##FUN##_vs;\
+struct numvec_op_##FUN##_sv;\
+template<typename T, int len>\
+struct numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vv>\
+{\
+  numvec_delayed(const numvec<T,len> &left_, const numvec<T,len> &right_) : left(left_), right(right_) {}\
+  const numvec<T,len> &left, &right;\
+  void apply(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] = FUN(left[i],right[i]);\
+  }\
+  void apply_addto(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] += FUN(left[i],right[i]);\
+  }\
+  void apply_multo(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] *= FUN(left[i],right[i]);\
+  }\
+};\
+template<typename T, int len>\
+struct numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vs>\
+{\
+  numvec_delayed(const numvec<T,len> &left_, const T &right_) : left(left_), right(right_) {}\
+  const numvec<T,len> &left;\
+  const T right;\
+  void apply(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] = FUN(left[i],right);\
+  }\
+  void apply_addto(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] += FUN(left[i],right);\
+  }\
+  void apply_multo(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] *= FUN(left[i],right);\
+  }\
+};\
+template<typename T, int len>\
+struct numvec_delayed<numvec<T,len>,numvec_op_##FUN##_sv>\
+{\
+  numvec_delayed(const T &left_, const numvec<T,len> &right_) : left(left_), right(right_) {}\
+  const T left;\
+  const numvec<T,len> &right;\
+  void apply(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] = FUN(left,right[i]);\
+  }\
+  void apply_addto(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] += FUN(left,right[i]);\
+  }\
+  void apply_multo(numvec<T,len> &arg) const\
+  {\
+    for (int i=0;i<arg.size();i++)\
+      arg[i] *= FUN(left,right[i]);\
+  }\
+};\
+template<typename T, int len>\
+numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vv> FUN(const numvec<T,len> &left, const numvec<T,len> &right)\
+{\
+  return numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vv>(left, right);\
+}\
+template<typename T, int len, typename S>\
+numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vs> FUN(const numvec<T,len> &left, const S &right)\
+{\
+  return numvec_delayed<numvec<T,len>,numvec_op_##FUN##_vs>(left, right);\
+}\
+template<typename T, int len, typename S>\
+numvec_delayed<numvec<T,len>,numvec_op_##FUN##_sv> FUN(const S &left, const numvec<T,len> &right)\
+{\
+  return numvec_delayed<numvec<T,len>,numvec_op_##FUN##_sv>(left, right);\
+}
+
+NUMVEC_BINARY(atan2)
+NUMVEC_BINARY(hypot)
+NUMVEC_BINARY(fmin)
+NUMVEC_BINARY(fmax)
+
+// MULTIPLE OUTPUT FUNCTIONS
+// Related functions of the same argument computed in one pass over
+// the input. The scalar versions make it possible to use them in
+// kernels templated on the vector type. The outputs must not alias
+// the input.
+
+template<typename T, int len>
+void sincos(const numvec<T,len> &x, numvec<T,len> &s, numvec<T,len> &c)
+{
+  for (int i=0;i<len;i++)
+    {
+      s[i] = sin(x[i]);
+      c[i] = cos(x[i]);
+    }
+}
+inline void sincos(double x, double &s, double &c)
+{
+  s = sin(x);
+  c = cos(x);
+}
+
+// exp(x) and exp(x)-1. Both are evaluated, since expm1(x)+1 loses
+// the relative precision of exp(x) for negative x.
+template<typename T, int len>
+void exp_and_expm1(const numvec<T,len> &x, numvec<T,len> &e, numvec<T,len> &em1)
+{
+  for (int i=0;i<len;i++)
+    {
+      e[i] = exp(x[i]);
+      em1[i] = expm1(x[i]);
+    }
+}
+inline void exp_and_expm1(double x, double &e, double &em1)
+{
+  e = exp(x);
+  em1 = expm1(x);
+}
+
+// x^(1/3) and x^(-1/3), replacing pow(x,1.0/3.0) and pow(x,-1.0/3.0).
+template<typename T, int len>
+void cbrt_and_rcbrt(const numvec<T,len> &x, numvec<T,len> &c, numvec<T,len> &rc)
+{
+  for (int i=0;i<len;i++)
+    {
+      c[i] = cbrt(x[i]);
+      rc[i] = 1/c[i];
+    }
+}
+inline void cbrt_and_rcbrt(double x, double &c, double &rc)
+{
+  c = cbrt(x);
+  rc = 1/c;
+}
+
+// STREAMING STORES AND PREFETCH
+
+// For outputs much larger than the last level cache, compute each
+// block into a cache resident numvec and write it out with
+// numvec_stream(). This bypasses the cache and avoids reading the
+// destination before writing it. Call numvec_stream_fence() once
+// after the last block, before the data is used by another thread.
+
+#define NUMVEC_CACHE_LINE 64
+
+template<typename T, int len>
+void numvec_stream(T *dst, const numvec<T,len> &v)
+{
+  for (int i=0;i<len;i++)
+    dst[i] = v[i];
+}
+
+#ifdef __SSE2__
+template<int len>
+void numvec_stream(double *dst, const numvec<double,len> &v)
+{
+  int i = 0;
+  if (reinterpret_cast<uintptr_t>(dst) & 15)
+    {
+      dst[0] = v[0];
+      i = 1;
+    }
+#ifdef __AVX__
+  if (i+2 <= len && (reinterpret_cast<uintptr_t>(dst+i) & 31))
+    {
+      _mm_stream_pd(dst+i, _mm_loadu_pd(v.c+i));
+      i += 2;
+    }
+  for (;i+4<=len;i+=4)
+    _mm256_stream_pd(dst+i, _mm256_loadu_pd(v.c+i));
+#endif
+  for (;i+2<=len;i+=2)
+    _mm_stream_pd(dst+i, _mm_loadu_pd(v.c+i));
+  for (;i<len;i++)
+    dst[i] = v[i];
+}
+#endif
+
+inline void numvec_stream_fence()
+{
+#ifdef __SSE2__
+  _mm_sfence();
+#endif
+}
+
+// Prefetch a memory range into the cache, one cache line at a time.
+inline void numvec_prefetch(const void *p, size_t bytes)
+{
+#ifdef __GNUC__
+  const char *c = static_cast<const char *>(p);
+  for (size_t i=0;i<bytes;i+=NUMVEC_CACHE_LINE)
+    __builtin_prefetch(c+i);
+#endif
+}
 
 #endif
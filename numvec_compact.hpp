@@ -0,0 +1,120 @@
+#ifndef NUMVEC_COMPACT_HPP
+#define NUMVEC_COMPACT_HPP
+#include <cstddef>
+#include "numvec.hpp"
+#ifdef __AVX512F__
+#include <immintrin.h>
+#endif
+
+// Screening: skip points where the kernel result is negligible.
+// numvec_screen() builds the sorted list of significant point indices,
+// and numvec_screened_apply() gathers these points from the inputs
+// into dense blocks, runs the kernel on them and scatters the results
+// back, writing a fill value to the skipped points. The kernel work
+// thus scales with the number of significant points. Inputs and output
+// are plain arrays with one value per point.
+// Example, for a kernel with two inputs:
+//   size_t nact = numvec_screen(rho, n, 1e-14, idx);
+//   const double *in[2] = {rho, sigma};
+//   numvec_screened_apply<double,32,2>(exc, in, n, idx, nact, 0.0,
+//     [](numvec<double,32> &out, const numvec<double,32> *x) { ... });
+
+// Indices i < n for which pred(i) is true. idx must have room for n
+// entries. Returns the number of indices.
+template<class Pred>
+size_t numvec_screen_if(size_t n, Pred pred, size_t *idx)
+{
+  size_t count = 0;
+  for (size_t i=0;i<n;i++)
+    if (pred(i))
+      idx[count++] = i;
+  return count;
+}
+
+// Indices i < n for which x[i] > threshold.
+template<typename T>
+size_t numvec_screen(const T *x, size_t n, T threshold, size_t *idx)
+{
+  size_t count = 0;
+  for (size_t i=0;i<n;i++)
+    {
+      // Branch free: always store, only advance on significant points.
+      idx[count] = i;
+      count += x[i] > threshold;
+    }
+  return count;
+}
+
+#ifdef __AVX512F__
+// Compress store of the lane indices, eight points at a time.
+inline size_t numvec_screen(const double *x, size_t n, double threshold, size_t *idx)
+{
+  static_assert(sizeof(size_t) == 8, "numvec_screen assumes 64 bit size_t");
+  size_t count = 0, i = 0;
+  const __m512d thr = _mm512_set1_pd(threshold);
+  __m512i lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m512i eight = _mm512_set1_epi64(8);
+  for (;i+8<=n;i+=8)
+    {
+      __mmask8 m = _mm512_cmp_pd_mask(_mm512_loadu_pd(x+i), thr, _CMP_GT_OQ);
+      _mm512_mask_compressstoreu_epi64(idx+count, m, lanes);
+      count += __builtin_popcount(m);
+      lanes = _mm512_add_epi64(lanes, eight);
+    }
+  for (;i<n;i++)
+    {
+      idx[count] = i;
+      count += x[i] > threshold;
+    }
+  return count;
+}
+#endif
+
+// dst[j] = src[idx[j]] for j < count. Lanes count..len-1 are padded
+// with the first gathered value, so that the kernel sees valid input.
+template<typename T, int len>
+void numvec_gather(numvec<T,len> &dst, const T *src, const size_t *idx, int count)
+{
+  for (int j=0;j<count;j++)
+    dst[j] = src[idx[j]];
+  for (int j=count;j<len;j++)
+    dst[j] = dst[0];
+}
+
+// dst[idx[j]] = src[j] for j < count.
+template<typename T, int len>
+void numvec_scatter(T *dst, const numvec<T,len> &src, const size_t *idx, int count)
+{
+  for (int j=0;j<count;j++)
+    dst[idx[j]] = src[j];
+}
+
+// Evaluate kernel(out, in) on the nidx points listed in idx (sorted,
+// as returned by numvec_screen), with in[k] gathered from src[k], and
+// set all other points of dst[0..n-1] to fill.
+template<typename T, int len, int nin, class Kernel>
+void numvec_screened_apply(T *dst, const T *const src[], size_t n,
+			   const size_t *idx, size_t nidx, T fill, Kernel kernel)
+{
+  numvec<T,len> in[nin], out;
+  size_t next = 0; // First point not yet written
+  for (size_t j=0;j<nidx;j+=len)
+    {
+      int count = nidx - j < size_t(len) ? int(nidx - j) : len;
+      for (int k=0;k<nin;k++)
+	numvec_gather(in[k], src[k], idx+j, count);
+      kernel(out, static_cast<const numvec<T,len> *>(in));
+      // Fill the skipped points up to the last one of this block.
+      for (int l=0;l<count;l++)
+	{
+	  for (;next<idx[j+l];next++)
+	    dst[next] = fill;
+	  next++;
+	}
+      numvec_scatter(dst, out, idx+j, count);
+    }
+  for (;next<n;next++)
+    dst[next] = fill;
+}
+
+#endif
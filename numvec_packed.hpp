@@ -0,0 +1,207 @@
+#ifndef NUMVEC_PACKED_HPP
+#define NUMVEC_PACKED_HPP
+#include <cstring>
+#include <stdint.h>
+#include "numvec.hpp"
+#if defined(__F16C__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Reduced precision storage for long lived, bandwidth bound arrays.
+// A numvec_packed<S,len> holds len values in the storage type S, which
+// is float, numvec_half (IEEE binary16) or numvec_bfloat16. Computation
+// is done in ordinary numvecs: load() widens into a numvec<float,len>
+// or numvec<double,len>, and store() narrows with round to nearest
+// even. From double the result is nearest except for rare double
+// rounding ties, see NUMVEC_PACKED_VIA_FLOAT. Example:
+//   numvec_packed<numvec_half,64> *rho = ...; // 2 bytes per point
+//   numvec<double,64> r, out;
+//   rho[i].load(r);
+//   out = exp(r);
+//   result[i].store(out);
+// Half precision conversion uses F16C or AVX-512F when available;
+// bfloat16 conversion is integer arithmetic that the compiler
+// vectorizes.
+
+struct numvec_half { uint16_t bits; };
+struct numvec_bfloat16 { uint16_t bits; };
+
+inline uint32_t numvec_float_bits(float f)
+{
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+inline float numvec_bits_float(uint32_t u)
+{
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// Scalar conversions, used for the tails of the vector loops.
+
+inline float numvec_half_to_float(numvec_half h)
+{
+  uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+  uint32_t exponent = (h.bits >> 10) & 0x1f;
+  uint32_t mantissa = h.bits & 0x3ff;
+  if (exponent == 0x1f) // Inf or NaN
+    return numvec_bits_float(sign | 0x7f800000 | (mantissa << 13));
+  if (exponent == 0) // Zero or subnormal, exact in float
+    {
+      float f = mantissa*(1.0f/(1 << 24));
+      return sign ? -f : f;
+    }
+  return numvec_bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+inline numvec_half numvec_float_to_half(float f)
+{
+  uint32_t u = numvec_float_bits(f);
+  uint16_t sign = (u >> 16) & 0x8000;
+  uint32_t a = u & 0x7fffffff;
+  numvec_half h;
+  if (a >= 0x7f800000) // Inf or NaN, keeping NaNs quiet
+    h.bits = sign | 0x7c00 | (a > 0x7f800000 ? 0x200 | ((a >> 13) & 0x3ff) : 0);
+  else if (a >= 0x477ff000) // Rounds to more than the largest half
+    h.bits = sign | 0x7c00;
+  else if (a < 0x38800000) // Subnormal half: round in float arithmetic
+    h.bits = sign | uint16_t(nearbyintf(numvec_bits_float(a)*(1 << 24)));
+  else
+    {
+      // Rebias the exponent and round the mantissa to nearest even.
+      a += ((uint32_t(15) - 127) << 23) + 0xfff + ((a >> 13) & 1);
+      h.bits = sign | uint16_t(a >> 13);
+    }
+  return h;
+}
+
+inline float numvec_bfloat16_to_float(numvec_bfloat16 b)
+{
+  return numvec_bits_float(uint32_t(b.bits) << 16);
+}
+
+inline numvec_bfloat16 numvec_float_to_bfloat16(float f)
+{
+  uint32_t u = numvec_float_bits(f);
+  numvec_bfloat16 b;
+  if ((u & 0x7fffffff) > 0x7f800000) // NaN, keep it quiet
+    b.bits = (u >> 16) | 0x40;
+  else
+    b.bits = (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+  return b;
+}
+
+// Block conversions between storage and compute types.
+
+template<typename S, typename T>
+void numvec_widen(const S *src, T *dst, int n)
+{
+  for (int i=0;i<n;i++)
+    dst[i] = src[i];
+}
+
+template<typename S, typename T>
+void numvec_narrow(const T *src, S *dst, int n)
+{
+  for (int i=0;i<n;i++)
+    dst[i] = static_cast<S>(src[i]);
+}
+
+inline void numvec_widen(const numvec_half *src, float *dst, int n)
+{
+  int i = 0;
+#if defined(__AVX512F__)
+  for (;i+16<=n;i+=16)
+    _mm512_storeu_ps(dst+i, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src+i))));
+#elif defined(__F16C__)
+  for (;i+8<=n;i+=8)
+    _mm256_storeu_ps(dst+i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src+i))));
+#endif
+  for (;i<n;i++)
+    dst[i] = numvec_half_to_float(src[i]);
+}
+
+inline void numvec_narrow(const float *src, numvec_half *dst, int n)
+{
+  int i = 0;
+#if defined(__AVX512F__)
+  for (;i+16<=n;i+=16)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst+i),
+			_mm512_cvtps_ph(_mm512_loadu_ps(src+i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+#elif defined(__F16C__)
+  for (;i+8<=n;i+=8)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst+i),
+		     _mm256_cvtps_ph(_mm256_loadu_ps(src+i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+  for (;i<n;i++)
+    dst[i] = numvec_float_to_half(src[i]);
+}
+
+inline void numvec_widen(const numvec_bfloat16 *src, float *dst, int n)
+{
+  for (int i=0;i<n;i++)
+    dst[i] = numvec_bfloat16_to_float(src[i]);
+}
+
+inline void numvec_narrow(const float *src, numvec_bfloat16 *dst, int n)
+{
+  for (int i=0;i<n;i++)
+    dst[i] = numvec_float_to_bfloat16(src[i]);
+}
+
+// 16 bit storage to and from double goes through float, which holds
+// both formats exactly. Narrowing double to float first rounds twice:
+// a double just off a 16 bit tie can be rounded onto the tie in float
+// and then to even, one unit in the last 16 bit place from the nearest
+// value.
+#define NUMVEC_PACKED_VIA_FLOAT(S)\
+template<typename T>\
+void numvec_widen(const S *src, T *dst, int n)\
+{\
+  float tmp[64];\
+  for (int i=0;i<n;i+=64)\
+    {\
+      int m = n - i < 64 ? n - i : 64;\
+      numvec_widen(src+i, tmp, m);\
+      for (int j=0;j<m;j++)\
+	dst[i+j] = tmp[j];\
+    }\
+}\
+template<typename T>\
+void numvec_narrow(const T *src, S *dst, int n)\
+{\
+  float tmp[64];\
+  for (int i=0;i<n;i+=64)\
+    {\
+      int m = n - i < 64 ? n - i : 64;\
+      for (int j=0;j<m;j++)\
+	tmp[j] = static_cast<float>(src[i+j]);\
+      numvec_narrow(tmp, dst+i, m);\
+    }\
+}
+
+NUMVEC_PACKED_VIA_FLOAT(numvec_half)
+NUMVEC_PACKED_VIA_FLOAT(numvec_bfloat16)
+
+template<typename S, int len>
+class numvec_packed
+{
+public:
+  S c[len];
+  int size() const { return len; }
+  template<typename T>
+  void load(numvec<T,len> &v) const
+  {
+    numvec_widen(c, v.c, len);
+  }
+  template<typename T>
+  void store(const numvec<T,len> &v)
+  {
+    numvec_narrow(v.c, c, len);
+  }
+};
+
+#endif
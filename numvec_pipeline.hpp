@@ -0,0 +1,243 @@
+#ifndef NUMVEC_PIPELINE_HPP
+#define NUMVEC_PIPELINE_HPP
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+
+// Pipelined load/transform/kernel/store executor for numvec blocks.
+// Each stage runs on its own thread and hands blocks to the next
+// stage through lock-free single producer/single consumer ring
+// buffers, so that a slow input source can overlap with the kernel.
+// The number of blocks in flight (the queue depth) is fixed when the
+// pipeline is created; when all of them are in use the load stage
+// waits for the store stage to return one (back-pressure).
+// Usage, with In and Out being user structs of numvecs:
+//   numvec_pipeline<In,Out> pipe(8);
+//   pipe.run(nblocks,
+//            [&](size_t blk, In &in) { ... },           // load
+//            [&](const In &in, Out &out) { ... },      // kernel
+//            [&](size_t blk, const Out &out) { ... }); // store
+// An optional transform(In &in) stage can be given between load and
+// kernel. After run() the per stage statistics tell where the time
+// went.
+
+// Ring buffer of pointers with one producer and one consumer thread.
+template<typename T>
+class numvec_spsc_queue
+{
+public:
+  numvec_spsc_queue(size_t capacity) : buf(capacity+1), head(0), tail(0) {}
+  bool try_push(T *item)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t next = t + 1 == buf.size() ? 0 : t + 1;
+    if (next == head.load(std::memory_order_acquire))
+      return false;
+    buf[t] = item;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+  bool try_pop(T *&item)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    item = buf[h];
+    head.store(h + 1 == buf.size() ? 0 : h + 1, std::memory_order_release);
+    return true;
+  }
+private:
+  std::vector<T*> buf;
+  // head is written by the consumer, tail by the producer. Keep them
+  // on separate cache lines.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+struct numvec_stage_stats
+{
+  const char *name;
+  size_t items;
+  double busy; // Seconds spent in the stage function
+  double wait; // Seconds spent waiting on the neighbouring queues
+  // Fraction of the stage lifetime spent doing useful work. The stage
+  // with the highest utilization is the bottleneck.
+  double utilization() const
+  {
+    return busy + wait > 0 ? busy/(busy + wait) : 0;
+  }
+};
+
+template<typename In, typename Out>
+class numvec_pipeline
+{
+public:
+  enum { LOAD, TRANSFORM, KERNEL, STORE, NSTAGES };
+  numvec_pipeline(int depth_ = 4) : depth(depth_ > 0 ? depth_ : 1), slots(depth)
+  {
+    static const char *names[NSTAGES] = {"load", "transform", "kernel", "store"};
+    for (int i=0;i<NSTAGES;i++)
+      {
+	st[i].name = names[i];
+	st[i].items = 0;
+	st[i].busy = 0;
+	st[i].wait = 0;
+      }
+  }
+  int queue_depth() const { return depth; }
+  const numvec_stage_stats &stats(int stage) const { return st[stage]; }
+  // Index of the stage with the highest utilization.
+  int bottleneck() const
+  {
+    int b = LOAD;
+    for (int i=1;i<NSTAGES;i++)
+      if (st[i].utilization() > st[b].utilization())
+	b = i;
+    return b;
+  }
+  template<class Load, class Transform, class Kernel, class Store>
+  void run(size_t nblocks, Load load, Transform transform, Kernel kernel, Store store)
+  {
+    numvec_spsc_queue<slot> freeq(depth), loaded(depth), transformed(depth), computed(depth);
+    reset(freeq);
+    std::thread tl(&numvec_pipeline::load_loop<Load>, this, nblocks, load, std::ref(freeq), std::ref(loaded));
+    std::thread tt(&numvec_pipeline::stage_loop<transform_fn<Transform> >, this,
+		   transform_fn<Transform>(transform), std::ref(loaded), std::ref(transformed), TRANSFORM);
+    std::thread tk(&numvec_pipeline::stage_loop<kernel_fn<Kernel> >, this,
+		   kernel_fn<Kernel>(kernel), std::ref(transformed), std::ref(computed), KERNEL);
+    store_loop(store, computed, freeq);
+    tl.join();
+    tt.join();
+    tk.join();
+  }
+  template<class Load, class Kernel, class Store>
+  void run(size_t nblocks, Load load, Kernel kernel, Store store)
+  {
+    numvec_spsc_queue<slot> freeq(depth), loaded(depth), computed(depth);
+    reset(freeq);
+    std::thread tl(&numvec_pipeline::load_loop<Load>, this, nblocks, load, std::ref(freeq), std::ref(loaded));
+    std::thread tk(&numvec_pipeline::stage_loop<kernel_fn<Kernel> >, this,
+		   kernel_fn<Kernel>(kernel), std::ref(loaded), std::ref(computed), KERNEL);
+    store_loop(store, computed, freeq);
+    tl.join();
+    tk.join();
+  }
+private:
+  typedef std::chrono::steady_clock clock;
+  struct slot
+  {
+    size_t block;
+    In in;
+    Out out;
+  };
+  template<class F>
+  struct transform_fn
+  {
+    transform_fn(F f_) : f(f_) {}
+    void operator()(slot &s) { f(s.in); }
+    F f;
+  };
+  template<class F>
+  struct kernel_fn
+  {
+    kernel_fn(F f_) : f(f_) {}
+    void operator()(slot &s) { f(s.in, s.out); }
+    F f;
+  };
+  static double seconds(clock::time_point a, clock::time_point b)
+  {
+    return std::chrono::duration<double>(b - a).count();
+  }
+  void reset(numvec_spsc_queue<slot> &freeq)
+  {
+    for (int i=0;i<NSTAGES;i++)
+      {
+	st[i].items = 0;
+	st[i].busy = 0;
+	st[i].wait = 0;
+      }
+    for (int i=0;i<depth;i++)
+      freeq.try_push(&slots[i]);
+  }
+  // Blocking queue operations, accounting the time spent waiting.
+  static slot *pop(numvec_spsc_queue<slot> &q, numvec_stage_stats &s)
+  {
+    slot *p;
+    if (q.try_pop(p))
+      return p;
+    clock::time_point t0 = clock::now();
+    while (!q.try_pop(p))
+      std::this_thread::yield();
+    s.wait += seconds(t0, clock::now());
+    return p;
+  }
+  static void push(numvec_spsc_queue<slot> &q, slot *p, numvec_stage_stats &s)
+  {
+    if (q.try_push(p))
+      return;
+    clock::time_point t0 = clock::now();
+    while (!q.try_push(p))
+      std::this_thread::yield();
+    s.wait += seconds(t0, clock::now());
+  }
+  // The block index travels with the slot, a null pointer ends the
+  // stream. Each stage counts in a local copy of its statistics and
+  // writes it back when done, so that the threads do not share cache
+  // lines in the loop.
+  template<class Load>
+  void load_loop(size_t nblocks, Load load, numvec_spsc_queue<slot> &freeq, numvec_spsc_queue<slot> &out)
+  {
+    numvec_stage_stats s = st[LOAD];
+    for (size_t blk=0;blk<nblocks;blk++)
+      {
+	slot *p = pop(freeq, s);
+	clock::time_point t0 = clock::now();
+	p->block = blk;
+	load(blk, p->in);
+	s.busy += seconds(t0, clock::now());
+	s.items++;
+	push(out, p, s);
+      }
+    push(out, 0, s);
+    st[LOAD] = s;
+  }
+  template<class F>
+  void stage_loop(F f, numvec_spsc_queue<slot> &in, numvec_spsc_queue<slot> &out, int stage)
+  {
+    numvec_stage_stats s = st[stage];
+    slot *p;
+    while ((p = pop(in, s)))
+      {
+	clock::time_point t0 = clock::now();
+	f(*p);
+	s.busy += seconds(t0, clock::now());
+	s.items++;
+	push(out, p, s);
+      }
+    push(out, 0, s);
+    st[stage] = s;
+  }
+  template<class Store>
+  void store_loop(Store store, numvec_spsc_queue<slot> &in, numvec_spsc_queue<slot> &freeq)
+  {
+    numvec_stage_stats s = st[STORE];
+    slot *p;
+    while ((p = pop(in, s)))
+      {
+	clock::time_point t0 = clock::now();
+	store(p->block, p->out);
+	s.busy += seconds(t0, clock::now());
+	s.items++;
+	push(freeq, p, s);
+      }
+    st[STORE] = s;
+  }
+  int depth;
+  std::vector<slot> slots;
+  numvec_stage_stats st[NSTAGES];
+};
+
+#endif
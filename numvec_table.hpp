@@ -0,0 +1,198 @@
+#ifndef NUMVEC_TABLE_HPP
+#define NUMVEC_TABLE_HPP
+#include <vector>
+#include <limits>
+#include <functional>
+#include "numvec.hpp"
+
+// Tabulated approximation of a smooth function on a bounded interval
+// [lo,hi]. The interval is split in uniform subintervals, and on each
+// of them the function is interpolated at Chebyshev nodes by a
+// polynomial of degree numvec_table<T>::degree. The number of
+// subintervals is doubled until the absolute error, sampled between
+// the nodes, is below the requested tolerance. The subinterval is
+// found by a multiplication and a truncation, and its coefficients are
+// then loaded with an index computed per element. Keep the tables small
+// so that they stay in the L1 cache.
+//
+// Arguments outside [lo,hi] are handled according to the range policy:
+// NUMVEC_TABLE_CLAMP  evaluate at the nearest end point
+// NUMVEC_TABLE_NAN    return NaN
+// NUMVEC_TABLE_EXACT  call the original function, a per element branch
+//                     and std::function call (slow path)
+//
+// Example:
+//   numvec_table<double> expc([](double x) { return exp(-0.2533*x); },
+//                             0.0, 20.0, 1e-13, NUMVEC_TABLE_EXACT);
+//   omega = expc(icbrtn);
+// The table is callable both on scalars and on numvecs, so it can be
+// used in kernels templated on the vector type.
+
+enum numvec_table_range
+{
+  NUMVEC_TABLE_CLAMP,
+  NUMVEC_TABLE_NAN,
+  NUMVEC_TABLE_EXACT
+};
+
+struct numvec_op_table;
+template<typename T> class numvec_table;
+
+template<typename T, int len>
+struct numvec_delayed<numvec<T,len>,numvec_op_table>
+{
+  numvec_delayed(const numvec_table<T> &tab_, const numvec<T,len> &val_) : tab(tab_), val(val_) {}
+  const numvec_table<T> &tab;
+  const numvec<T,len> &val;
+  void apply(numvec<T,len> &arg) const
+  {
+    tab.eval(val.c, arg.c, len, assign());
+  }
+  void apply_addto(numvec<T,len> &arg) const
+  {
+    tab.eval(val.c, arg.c, len, addto());
+  }
+  void apply_multo(numvec<T,len> &arg) const
+  {
+    tab.eval(val.c, arg.c, len, multo());
+  }
+private:
+  struct assign { void operator()(T &y, T v) const { y = v; } };
+  struct addto { void operator()(T &y, T v) const { y += v; } };
+  struct multo { void operator()(T &y, T v) const { y *= v; } };
+};
+
+template<typename T>
+class numvec_table
+{
+public:
+  enum { degree = 5, ncoef = degree + 1 };
+  template<class F>
+  numvec_table(F f_, T lo_, T hi_, T tol, numvec_table_range range_ = NUMVEC_TABLE_CLAMP,
+	       int max_intervals = 4096)
+    : f(f_), lo(lo_), hi(hi_), range(range_)
+  {
+    for (n=1;;n*=2)
+      {
+	build();
+	err = max_error();
+	if (err <= tol || 2*n > max_intervals)
+	  break;
+      }
+    tol_met = err <= tol;
+  }
+  T lower() const { return lo; }
+  T upper() const { return hi; }
+  int intervals() const { return n; }
+  // Largest sampled absolute error, and whether it meets the tolerance
+  // given to the constructor within max_intervals subintervals.
+  T error() const { return err; }
+  bool converged() const { return tol_met; }
+  T operator()(T x) const
+  {
+    T y = 0;
+    eval(&x, &y, 1, assign());
+    return y;
+  }
+  template<int len>
+  numvec_delayed<numvec<T,len>,numvec_op_table> operator()(const numvec<T,len> &x) const
+  {
+    return numvec_delayed<numvec<T,len>,numvec_op_table>(*this, x);
+  }
+  // y[i] op= f(x[i]) for i < count. x and y may be the same array.
+  template<class OP>
+  void eval(const T *x, T *y, int count, OP op) const
+  {
+    switch (range)
+      {
+      case NUMVEC_TABLE_CLAMP:
+	for (int i=0;i<count;i++)
+	  op(y[i], poly(x[i]));
+	break;
+      case NUMVEC_TABLE_NAN:
+	for (int i=0;i<count;i++)
+	  {
+	    T p = poly(x[i]);
+	    op(y[i], (x[i] >= lo && x[i] <= hi) ? p : std::numeric_limits<T>::quiet_NaN());
+	  }
+	break;
+      case NUMVEC_TABLE_EXACT:
+	for (int i=0;i<count;i++)
+	  op(y[i], (x[i] >= lo && x[i] <= hi) ? poly(x[i]) : f(x[i]));
+	break;
+      }
+  }
+private:
+  struct assign { void operator()(T &y, T v) const { y = v; } };
+  // Polynomial of the subinterval containing x, in the local
+  // coordinate u in [-1,1]. Arguments outside [lo,hi], and NaN, are
+  // clamped.
+  T poly(T x) const
+  {
+    T t = (x - lo)*scale;
+    // Written so that NaN arguments collapse to t = 0.
+    t = t > 0 ? t : 0;
+    t = t < n ? t : n;
+    int k = static_cast<int>(t);
+    k = k < n - 1 ? k : n - 1;
+    T u = 2*(t - k) - 1;
+    const T *c = &coef[k*ncoef];
+    T p = c[degree];
+    for (int j=degree-1;j>=0;j--)
+      p = p*u + c[j];
+    return p;
+  }
+  void build()
+  {
+    scale = n/(hi - lo);
+    coef.assign(n*ncoef, 0);
+    // Monomial coefficients of the Chebyshev polynomials T_0..T_degree
+    T cheb[ncoef][ncoef] = {};
+    cheb[0][0] = 1;
+    cheb[1][1] = 1;
+    for (int j=2;j<ncoef;j++)
+      for (int m=0;m<ncoef;m++)
+	cheb[j][m] = (m > 0 ? 2*cheb[j-1][m-1] : 0) - cheb[j-2][m];
+    for (int k=0;k<n;k++)
+      {
+	T fx[ncoef];
+	for (int i=0;i<ncoef;i++)
+	  fx[i] = f(node(k, cos(M_PI*(i + 0.5)/ncoef)));
+	for (int j=0;j<ncoef;j++)
+	  {
+	    T a = 0;
+	    for (int i=0;i<ncoef;i++)
+	      a += fx[i]*cos(M_PI*j*(i + 0.5)/ncoef);
+	    a *= (j == 0 ? 1.0 : 2.0)/ncoef;
+	    for (int m=0;m<ncoef;m++)
+	      coef[k*ncoef+m] += a*cheb[j][m];
+	  }
+      }
+  }
+  T node(int k, T u) const
+  {
+    return lo + (k + (u + 1)/2)/scale;
+  }
+  // Sample each subinterval between the interpolation nodes.
+  T max_error() const
+  {
+    const int nsample = 4*ncoef;
+    T e = 0;
+    for (int k=0;k<n;k++)
+      for (int i=0;i<=nsample;i++)
+	{
+	  T x = node(k, -1 + 2*T(i)/nsample);
+	  T d = fabs(poly(x) - f(x));
+	  e = d > e ? d : e;
+	}
+    return e;
+  }
+  std::function<T(T)> f;
+  T lo, hi, scale, err;
+  int n;
+  bool tol_met;
+  numvec_table_range range;
+  std::vector<T> coef;
+};
+
+#endif
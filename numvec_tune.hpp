@@ -0,0 +1,134 @@
+#ifndef NUMVEC_TUNE_HPP
+#define NUMVEC_TUNE_HPP
+#include <map>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <utility>
+
+// Block length autotuning. The best block length of a kernel depends
+// on the number of temporaries, the instruction set and the cache
+// sizes, so it is measured rather than guessed. A block driver is a
+// class template over the block length with a static run() function:
+//   template<int len>
+//   struct my_driver
+//   {
+//     static void run(double *dst, const double *src, size_t n);
+//   };
+// numvec_autotune<my_driver>(repeat, args...) times run(args...) for
+// each of the candidate lengths and returns the fastest one, which can
+// be stored in a numvec_tune_table and saved to a file. At run time
+// numvec_dispatch<my_driver>(len, args...) calls the instantiation for
+// the tuned length.
+
+// All candidate lengths are instantiated for each driver.
+#define NUMVEC_TUNE_LENGTHS 4, 8, 16, 32, 64, 128, 256
+
+template<int... lens>
+struct numvec_tune_lengths;
+
+template<>
+struct numvec_tune_lengths<>
+{
+  template<template<int> class Driver, typename... Args>
+  static bool dispatch(int, Args&&...)
+  {
+    return false;
+  }
+  template<template<int> class Driver, typename... Args>
+  static void time(int, double &, int &, Args&&...)
+  {
+  }
+};
+
+template<int first, int... rest>
+struct numvec_tune_lengths<first, rest...>
+{
+  template<template<int> class Driver, typename... Args>
+  static bool dispatch(int len, Args&&... args)
+  {
+    if (len == first)
+      {
+	Driver<first>::run(std::forward<Args>(args)...);
+	return true;
+      }
+    return numvec_tune_lengths<rest...>::template dispatch<Driver>(len, std::forward<Args>(args)...);
+  }
+  // Best of repeat runs for each length, keeping the fastest.
+  template<template<int> class Driver, typename... Args>
+  static void time(int repeat, double &best_time, int &best_len, Args&&... args)
+  {
+    for (int r=0;r<repeat;r++)
+      {
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	Driver<first>::run(args...);
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (best_len == 0 || t < best_time)
+	  {
+	    best_time = t;
+	    best_len = first;
+	  }
+      }
+    numvec_tune_lengths<rest...>::template time<Driver>(repeat, best_time, best_len, args...);
+  }
+};
+
+typedef numvec_tune_lengths<NUMVEC_TUNE_LENGTHS> numvec_tune_candidates;
+
+// Call Driver<len>::run(args...). Returns false if len is not one of
+// the candidate lengths.
+template<template<int> class Driver, typename... Args>
+bool numvec_dispatch(int len, Args&&... args)
+{
+  return numvec_tune_candidates::dispatch<Driver>(len, std::forward<Args>(args)...);
+}
+
+// Fastest candidate length for Driver on this machine. The arguments
+// are passed to every run, so the driver must tolerate being called
+// repeatedly on the same data.
+template<template<int> class Driver, typename... Args>
+int numvec_autotune(int repeat, Args&&... args)
+{
+  double best_time = 0;
+  int best_len = 0;
+  numvec_tune_candidates::time<Driver>(repeat, best_time, best_len, args...);
+  return best_len;
+}
+
+// Tuned block length per kernel name, stored as "name length" lines.
+class numvec_tune_table
+{
+public:
+  // Returns false if the file could not be read.
+  bool load(const std::string &filename)
+  {
+    std::ifstream f(filename.c_str());
+    if (!f)
+      return false;
+    std::string name;
+    int len;
+    while (f >> name >> len)
+      lengths[name] = len;
+    return true;
+  }
+  bool save(const std::string &filename) const
+  {
+    std::ofstream f(filename.c_str());
+    for (std::map<std::string,int>::const_iterator i=lengths.begin();i!=lengths.end();++i)
+      f << i->first << " " << i->second << "\n";
+    return bool(f);
+  }
+  int get(const std::string &name, int default_len) const
+  {
+    std::map<std::string,int>::const_iterator i = lengths.find(name);
+    return i != lengths.end() ? i->second : default_len;
+  }
+  void set(const std::string &name, int len)
+  {
+    lengths[name] = len;
+  }
+private:
+  std::map<std::string,int> lengths;
+};
+
+#endif
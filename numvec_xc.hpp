@@ -0,0 +1,484 @@
+#ifndef NUMVEC_XC_HPP
+#define NUMVEC_XC_HPP
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include "numvec.hpp"
+
+// Exchange-correlation functionals on blocks of grid points.
+// All functionals share one block interface: a numvec_xc_block holds
+// the spin densities a, b and the gradient invariants
+// gaa = |grad a|^2, gab = grad a . grad b, gbb = |grad b|^2 of len
+// points, and prepare() computes the subexpressions that most
+// functionals need (n, n^(1/3), a^(4/3), |grad n|^2, ...) once. The
+// PW92 correlation energy, which PBE correlation builds on, is also
+// kept in the block, so a mix of pw92 and pbec computes it once.
+// Each functional is a kernel computing the energy density per
+// volume, e = n*eps_xc, from a prepared block, and is looked up by name
+// in a registry:
+//   slater  LDA exchange
+//   b88     Becke 88 exchange (including the LDA part)
+//   pbex    PBE exchange
+//   vwn5    Vosko-Wilk-Nusair correlation, parametrization 5
+//   pw92    Perdew-Wang 92 correlation
+//   pbec    PBE correlation
+//   lyp     Lee-Yang-Parr correlation
+// A numvec_xc_mix evaluates a linear combination of functionals in one
+// sweep over the grid, preparing each block once for all its terms:
+//   numvec_xc_mix<64> blyp;
+//   blyp.add("b88", 1.0);
+//   blyp.add("lyp", 1.0);
+//   blyp.eval(exc, a, b, gaa, gab, gbb, npoints);
+// Points where the total density is below the mix threshold get e = 0.
+// Only energies are computed, no derivatives.
+
+// Spin densities are floored at this value to keep the kernels finite.
+#define NUMVEC_XC_TINY 1e-30
+
+template<int len> struct numvec_xc_block;
+template<int len>
+void numvec_xc_pw92_eps(numvec<double,len> &eps, const numvec_xc_block<len> &d);
+
+template<int len>
+struct numvec_xc_block
+{
+  numvec_xc_block() : have_pw92(false) {}
+  // Input
+  numvec<double,len> a, b, gaa, gab, gbb;
+  // Shared subexpressions, set by prepare(). af and bf are a and b
+  // floored at NUMVEC_XC_TINY, and the kernels use them instead of the
+  // inputs, which prepare() leaves unchanged.
+  numvec<double,len> af, bf, n, cbrtn, icbrtn, a13, b13, a43, b43, zeta, gnn;
+  void prepare()
+  {
+    af = fmax(a, NUMVEC_XC_TINY);
+    bf = fmax(b, NUMVEC_XC_TINY);
+    n = af + bf;
+    cbrt_and_rcbrt(n, cbrtn, icbrtn);
+    a13 = cbrt(af);
+    b13 = cbrt(bf);
+    a43 = af*a13;
+    b43 = bf*b13;
+    zeta = af - bf;
+    zeta /= n;
+    gnn = gaa + gbb;
+    gnn += 2*gab;
+    have_pw92 = false;
+  }
+  // PW92 correlation energy per particle, which pw92 and pbec share.
+  // Computed on first use after prepare().
+  const numvec<double,len> &pw92_eps() const
+  {
+    if (!have_pw92)
+      {
+	numvec_xc_pw92_eps(pw92, *this);
+	have_pw92 = true;
+      }
+    return pw92;
+  }
+private:
+  mutable numvec<double,len> pw92;
+  mutable bool have_pw92;
+};
+
+// EXCHANGE
+
+template<int len>
+void numvec_xc_slater(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  const double cx = -0.75*cbrt(6/M_PI);
+  e = d.a43 + d.b43;
+  e *= cx;
+}
+
+// e -= beta*s^(4/3)*x^2/(1 + 6*beta*x*asinh(x)), x = sqrt(gss)/s^(4/3)
+template<int len>
+void numvec_xc_b88_spin(numvec<double,len> &e, const numvec<double,len> &s43, const numvec<double,len> &gss)
+{
+  const double beta = 0.0042;
+  numvec<double,len> x, tmp;
+  x = sqrt(gss);
+  x /= s43;
+  tmp = asinh(x);
+  tmp *= x;
+  tmp *= 6*beta;
+  tmp += 1.0;
+  x *= x;
+  x *= s43;
+  x /= tmp;
+  e += -beta*x;
+}
+
+// The Slater part is recomputed here, which costs one add and one
+// multiply on the shared a^(4/3), b^(4/3).
+template<int len>
+void numvec_xc_b88(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  numvec_xc_slater(e, d);
+  numvec_xc_b88_spin(e, d.a43, d.gaa);
+  numvec_xc_b88_spin(e, d.b43, d.gbb);
+}
+
+// Spin scaled: e += cx*s^(4/3)*F(s2), F = 1 + kappa - kappa/(1 + mu*s2/kappa),
+// with s2 the reduced gradient squared of the density 2*s.
+template<int len>
+void numvec_xc_pbex_spin(numvec<double,len> &e, const numvec<double,len> &s43, const numvec<double,len> &gss)
+{
+  const double cx = -0.75*cbrt(6/M_PI);
+  const double kappa = 0.804;
+  const double mu = 0.2195149727645171;
+  numvec<double,len> f, tmp;
+  tmp = s43*s43;
+  tmp *= 4*pow(6*M_PI*M_PI, 2.0/3.0);
+  f = gss/tmp;
+  f *= mu/kappa;
+  f += 1.0;
+  f = -kappa/f;
+  f += 1 + kappa;
+  f *= s43;
+  e += cx*f;
+}
+
+template<int len>
+void numvec_xc_pbex(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  e = 0.0;
+  numvec_xc_pbex_spin(e, d.a43, d.gaa);
+  numvec_xc_pbex_spin(e, d.b43, d.gbb);
+}
+
+// CORRELATION
+
+// Spin interpolation of the correlation energy per particle:
+// eps = epsP + alpha*f(zeta)*(1 - zeta^4)/f''(0) + (epsF - epsP)*f(zeta)*zeta^4.
+// On return eps holds the result, epsF and alpha are overwritten.
+template<int len>
+void numvec_xc_spin_interpolate(numvec<double,len> &eps, numvec<double,len> &epsF, numvec<double,len> &alpha,
+				double fpp0, const numvec_xc_block<len> &d)
+{
+  numvec<double,len> f, z4;
+  // (1+zeta)^(4/3) + (1-zeta)^(4/3) = 2^(4/3)*(a^(4/3) + b^(4/3))/n^(4/3)
+  f = d.a43 + d.b43;
+  f *= d.icbrtn;
+  f /= d.n;
+  f *= cbrt(16.0)/(cbrt(16.0) - 2);
+  f += -2/(cbrt(16.0) - 2);
+  z4 = d.zeta*d.zeta;
+  z4 *= z4;
+  epsF -= eps;
+  epsF *= z4;
+  z4 = 1.0 - z4;
+  alpha *= z4;
+  alpha /= fpp0;
+  epsF += alpha;
+  epsF *= f;
+  eps += epsF;
+}
+
+// PW92: G = -2A(1 + alpha1*rs)*ln(1 + 1/(2A(beta1*rs^(1/2) + beta2*rs + beta3*rs^(3/2) + beta4*rs^2)))
+// p = {A, alpha1, beta1, beta2, beta3, beta4}
+template<int len>
+void numvec_xc_pw92_g(numvec<double,len> &g, const numvec<double,len> &rs, const numvec<double,len> &srs,
+		      const double p[6])
+{
+  numvec<double,len> q;
+  q = p[5]*srs;
+  q += p[4];
+  q *= srs;
+  q += p[3];
+  q *= srs;
+  q += p[2];
+  q *= srs;
+  q *= 2*p[0];
+  g = 1.0/q;
+  g = log1p(g);
+  q = p[1]*rs;
+  q += 1.0;
+  g *= q;
+  g *= -2*p[0];
+}
+
+template<int len>
+void numvec_xc_pw92_eps(numvec<double,len> &eps, const numvec_xc_block<len> &d)
+{
+  static const double para[6] = {0.031091, 0.21370, 7.5957, 3.5876, 1.6382, 0.49294};
+  static const double ferro[6] = {0.015545, 0.20548, 14.1189, 6.1977, 3.3662, 0.62517};
+  static const double stiff[6] = {0.016887, 0.11125, 10.357, 3.6231, 0.88026, 0.49671};
+  numvec<double,len> rs, srs, epsF, alpha;
+  rs = cbrt(3/(4*M_PI))*d.icbrtn;
+  srs = sqrt(rs);
+  numvec_xc_pw92_g(eps, rs, srs, para);
+  numvec_xc_pw92_g(epsF, rs, srs, ferro);
+  numvec_xc_pw92_g(alpha, rs, srs, stiff);
+  // G with the stiffness parameters is -alpha
+  numvec_xc_spin_interpolate(eps, epsF, alpha, -1.709921, d);
+}
+
+template<int len>
+void numvec_xc_pw92(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  e = d.pw92_eps();
+  e *= d.n;
+}
+
+// VWN: A*(ln(x^2/X(x)) + 2b/Q*atan(Q/(2x + b))
+//         - b*x0/X(x0)*(ln((x - x0)^2/X(x)) + 2(b + 2x0)/Q*atan(Q/(2x + b)))),
+// X(x) = x^2 + b*x + c, Q = sqrt(4c - b^2), x = rs^(1/2).
+// p = {A, x0, b, c}
+template<int len>
+void numvec_xc_vwn_aux(numvec<double,len> &g, const numvec<double,len> &x, const double p[4])
+{
+  const double A = p[0], x0 = p[1], b = p[2], c = p[3];
+  const double Q = sqrt(4*c - b*b);
+  const double X0 = x0*x0 + b*x0 + c;
+  numvec<double,len> X, at, l;
+  X = x + b;
+  X *= x;
+  X += c;
+  at = 2*x;
+  at += b;
+  at = Q/at;
+  at = atan(at);
+  l = x - x0;
+  l *= l;
+  l /= X;
+  l = log(l);
+  l += (2*(b + 2*x0)/Q)*at;
+  l *= -b*x0/X0;
+  g = x*x;
+  g /= X;
+  g = log(g);
+  g += l;
+  g += (2*b/Q)*at;
+  g *= A;
+}
+
+template<int len>
+void numvec_xc_vwn5(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  static const double para[4] = {0.0310907, -0.10498, 3.72744, 12.9352};
+  static const double ferro[4] = {0.01554535, -0.32500, 7.06042, 18.0578};
+  static const double stiff[4] = {-1/(6*M_PI*M_PI), -0.0047584, 1.13107, 13.0045};
+  numvec<double,len> x, epsF, alpha;
+  x = cbrt(3/(4*M_PI))*d.icbrtn;
+  x = sqrt(x);
+  numvec_xc_vwn_aux(e, x, para);
+  numvec_xc_vwn_aux(epsF, x, ferro);
+  numvec_xc_vwn_aux(alpha, x, stiff);
+  numvec_xc_spin_interpolate(e, epsF, alpha, 4/(9*(cbrt(2.0) - 1)), d);
+  e *= d.n;
+}
+
+// PBE: eps = eps_PW92 + H, H = gamma*phi^3*ln(1 + beta/gamma*t^2*(1 + A*t^2)/(1 + A*t^2 + A^2*t^4)),
+// A = beta/gamma/(exp(-eps_PW92/(gamma*phi^3)) - 1)
+template<int len>
+void numvec_xc_pbec(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  const double gamma = (1 - M_LN2)/(M_PI*M_PI);
+  const double beta = 0.06672455060314922;
+  numvec<double,len> eps, phi, gphi3, A, t2, tmp;
+  eps = d.pw92_eps();
+  // phi = ((1+zeta)^(2/3) + (1-zeta)^(2/3))/2 = (a^(2/3) + b^(2/3))/(2^(1/3) n^(2/3))
+  phi = d.a13*d.a13;
+  tmp = d.b13*d.b13;
+  phi += tmp;
+  phi *= d.icbrtn;
+  phi *= d.icbrtn;
+  phi *= 1/cbrt(2.0);
+  gphi3 = phi*phi;
+  gphi3 *= phi;
+  gphi3 *= gamma;
+  A = eps/gphi3;
+  A *= -1.0;
+  A = expm1(A);
+  A = (beta/gamma)/A;
+  // t^2 = |grad n|^2/(4 phi^2 ks^2 n^2), ks^2 = 4 (3 pi^2 n)^(1/3)/pi
+  t2 = phi*d.n;
+  t2 *= t2;
+  t2 = d.gnn/t2;
+  t2 *= d.icbrtn;
+  t2 *= M_PI/(16*cbrt(3*M_PI*M_PI));
+  A *= t2;
+  tmp = A*A;
+  A += 1.0;
+  tmp += A;
+  A /= tmp;
+  A *= t2;
+  A *= beta/gamma;
+  tmp = log1p(A);
+  tmp *= gphi3;
+  eps += tmp;
+  e = eps*d.n;
+}
+
+template<int len>
+void numvec_xc_lyp(numvec<double,len> &e, const numvec_xc_block<len> &d)
+{
+  const double A = 0.04918;
+  const double B = 0.132;
+  const double C = 0.2533;
+  const double Dd = 0.349;
+  const double CF = 0.3*pow(3*M_PI*M_PI,2.0/3.0);
+  numvec<double,len> P, delta, omega, n2, tmp, tmp2, tmp3;
+  tmp = Dd*d.icbrtn;
+  tmp += 1.0;
+  P = 1.0/tmp;
+  tmp = Dd*P;
+  tmp += C;
+  delta = d.icbrtn*tmp;
+  tmp = -C*d.icbrtn;
+  omega = exp(tmp);
+  omega *= P;
+  n2 = d.n*d.n;
+  // n^(-11/3) = 1/(n^3 n^(2/3))
+  tmp = d.cbrtn*d.cbrtn;
+  tmp *= n2;
+  tmp *= d.n;
+  omega /= tmp;
+  e = 4*d.af;
+  e *= d.bf;
+  e *= P/d.n;
+  // a^(8/3) + b^(8/3)
+  tmp = d.a43*d.a43;
+  tmp2 = d.b43*d.b43;
+  tmp += tmp2;
+  tmp *= pow(2,11.0/3.0)*CF;
+  tmp2 = 47.0;
+  tmp2 += -7.0*delta;
+  tmp2 *= d.gnn/18.0;
+  tmp += tmp2;
+
+  tmp2 = -2.5;
+  tmp2 += delta/18.0;
+  tmp2 *= d.gaa + d.gbb;
+  tmp += tmp2;
+
+  tmp2 = 11.0 - delta;
+  tmp2 /= 9.0*d.n;
+  tmp3 = d.af*d.gaa;
+  tmp3 += d.bf*d.gbb;
+  tmp += tmp2*tmp3;
+
+  tmp *= d.af*d.bf;
+
+  tmp2 = (-2.0/3.0)*n2;
+  tmp2 *= d.gnn;
+  tmp += tmp2;
+
+  tmp2 = (-2.0/3.0)*n2;
+  tmp2 += d.af*d.af;
+  tmp2 *= d.gbb;
+  tmp -= tmp2;
+
+  tmp2 = (-2.0/3.0)*n2;
+  tmp2 += d.bf*d.bf;
+  tmp2 *= d.gaa;
+  tmp -= tmp2;
+
+  tmp *= B*omega;
+  e += tmp;
+  e *= -A;
+}
+
+// REGISTRY
+
+template<int len>
+struct numvec_xc_functional
+{
+  const char *name;
+  void (*eval)(numvec<double,len> &e, const numvec_xc_block<len> &d);
+};
+
+// All functionals, terminated by a null name.
+template<int len>
+const numvec_xc_functional<len> *numvec_xc_functionals()
+{
+  static const numvec_xc_functional<len> list[] =
+    {
+      {"slater", numvec_xc_slater<len>},
+      {"b88", numvec_xc_b88<len>},
+      {"pbex", numvec_xc_pbex<len>},
+      {"vwn5", numvec_xc_vwn5<len>},
+      {"pw92", numvec_xc_pw92<len>},
+      {"pbec", numvec_xc_pbec<len>},
+      {"lyp", numvec_xc_lyp<len>},
+      {0, 0}
+    };
+  return list;
+}
+
+// Returns 0 if there is no functional with this name.
+template<int len>
+const numvec_xc_functional<len> *numvec_xc_lookup(const char *name)
+{
+  for (const numvec_xc_functional<len> *f = numvec_xc_functionals<len>();f->name;f++)
+    if (strcmp(f->name, name) == 0)
+      return f;
+  return 0;
+}
+
+// Linear combination of functionals, evaluated in one sweep.
+template<int len>
+class numvec_xc_mix
+{
+public:
+  numvec_xc_mix() : threshold(1e-14) {}
+  // Returns false if the functional is unknown.
+  bool add(const char *name, double coef)
+  {
+    const numvec_xc_functional<len> *f = numvec_xc_lookup<len>(name);
+    if (!f)
+      return false;
+    terms.push_back(term(f, coef));
+    return true;
+  }
+  void set_threshold(double t) { threshold = t; }
+  // e = sum of coef*functional on the block, which is prepared here.
+  void eval(numvec<double,len> &e, numvec_xc_block<len> &d) const
+  {
+    numvec<double,len> tmp;
+    d.prepare();
+    e = 0.0;
+    for (size_t k=0;k<terms.size();k++)
+      {
+	terms[k].first->eval(tmp, d);
+	e += terms[k].second*tmp;
+      }
+    for (int i=0;i<len;i++)
+      e[i] = d.n[i] > threshold ? e[i] : 0;
+  }
+  // The same on npoints grid points stored as one array per input.
+  void eval(double *e, const double *a, const double *b,
+	    const double *gaa, const double *gab, const double *gbb, size_t npoints) const
+  {
+    numvec_xc_block<len> d;
+    numvec<double,len> out;
+    for (size_t i=0;i<npoints;i+=len)
+      {
+	int count = npoints - i < size_t(len) ? int(npoints - i) : len;
+	load(d.a, a+i, count);
+	load(d.b, b+i, count);
+	load(d.gaa, gaa+i, count);
+	load(d.gab, gab+i, count);
+	load(d.gbb, gbb+i, count);
+	eval(out, d);
+	for (int j=0;j<count;j++)
+	  e[i+j] = out[j];
+      }
+  }
+private:
+  typedef std::pair<const numvec_xc_functional<len> *, double> term;
+  // Partial blocks are padded with the last point.
+  static void load(numvec<double,len> &v, const double *src, int count)
+  {
+    for (int j=0;j<count;j++)
+      v[j] = src[j];
+    for (int j=count;j<len;j++)
+      v[j] = src[count-1];
+  }
+  std::vector<term> terms;
+  double threshold;
+};
+
+#endif